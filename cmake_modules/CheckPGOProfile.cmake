@@ -0,0 +1,11 @@
+# Fails the PGO pipeline when the training run left no profile data behind, instead of
+# letting the USE build silently fall back to an unprofiled binary.
+#
+# Usage: cmake -DPROFILE_DIR=<dir> -DPROFILE_GLOB=<pattern> -P CheckPGOProfile.cmake
+
+file(GLOB_RECURSE PROFILE_FILES "${PROFILE_DIR}/${PROFILE_GLOB}")
+if(NOT PROFILE_FILES)
+    message(FATAL_ERROR "PGO training wrote no ${PROFILE_GLOB} files to ${PROFILE_DIR}")
+endif()
+list(LENGTH PROFILE_FILES PROFILE_COUNT)
+message(STATUS "PGO training wrote ${PROFILE_COUNT} profile file(s) to ${PROFILE_DIR}")
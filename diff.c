@@ -0,0 +1,343 @@
+#include "diff.h"
+
+struct DiffJob {
+    const struct DiffOptions *options;
+    SDL_atomic_t next_rom;
+    SDL_atomic_t diverged;
+    SDL_atomic_t load_failures;
+};
+
+// New execution engines are registered here, the first one is the reference
+static const struct Engine engines[] = {
+        { "interpreter", interpreter_step },
+};
+
+static SDL_mutex *output_lock;
+
+const struct Engine *find_engine(const char *name) {
+    for (size_t i = 0; i < sizeof(engines) / sizeof(*engines); i++) {
+        if (strcmp(engines[i].name, name) == 0) return &engines[i];
+    }
+    printf("Unknown engine %s\n", name);
+    return NULL;
+}
+
+int read_diff_arguments(int argc, char *argv[], struct DiffOptions *options) {
+    int32_t i = 1;
+    options->engine_a = options->engine_b = &engines[0];
+    options->seed = DIFF_DEFAULT_SEED;
+    options->steps = DIFF_DEFAULT_STEPS;
+    options->interval = 1;
+    options->jobs = SDL_GetCPUCount();
+    options->input = NULL;
+    options->input_length = 0;
+    options->roms = calloc(argc, sizeof(*options->roms));
+    options->rom_count = 0;
+    options->self_test = false;
+    for (; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp("--engine-a", argv[i]) == 0 && has_value) {
+            if (!(options->engine_a = find_engine(argv[++i]))) return -1;
+        } else if (strcmp("--engine-b", argv[i]) == 0 && has_value) {
+            if (!(options->engine_b = find_engine(argv[++i]))) return -1;
+        } else if (strcmp("--seed", argv[i]) == 0 && has_value) {
+            options->seed = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else if (strcmp("--input", argv[i]) == 0 && has_value) {
+            if (read_input_log(argv[++i], &options->input, &options->input_length) != 0) return -1;
+        } else if (strcmp("--steps", argv[i]) == 0 && has_value) {
+            options->steps = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp("--interval", argv[i]) == 0 && has_value) {
+            options->interval = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp("--jobs", argv[i]) == 0 && has_value) {
+            options->jobs = atoi(argv[++i]);
+        } else if (strcmp("--self-test", argv[i]) == 0) {
+            options->self_test = true;
+        } else if (strcmp("--shift-quirk", argv[i]) == 0) {
+            shift_quirk = true;
+        } else if (strcmp("--store-load-quirk", argv[i]) == 0) {
+            store_load_quirk = true;
+        } else if (strcmp("--jump-offset-quirk", argv[i]) == 0) {
+            jump_offset_quirk = true;
+        } else if (strncmp("--", argv[i], 2) == 0) {
+            printf("Unknown or incomplete option %s\n", argv[i]);
+            return -1;
+        } else {
+            options->roms[options->rom_count++] = argv[i];
+        }
+    }
+    if (options->rom_count == 0 && !options->self_test) {
+        printf("No ROMs to compare\n");
+        return -1;
+    }
+    if (options->interval == 0) options->interval = 1;
+    if (options->jobs < 1) options->jobs = 1;
+    if (options->jobs > options->rom_count) options->jobs = options->rom_count;
+    return 0;
+}
+
+int read_input_log(const char *path, struct InputEvent **events, size_t *length) {
+    unsigned long long at;
+    unsigned int key, pressed;
+    size_t capacity = 0;
+    int matched;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("Can't open %s\n", path);
+        return -1;
+    }
+    *events = NULL;
+    *length = 0;
+    while ((matched = fscanf(fp, "%llu %x %u", &at, &key, &pressed)) == 3) {
+        if (key > 0xF || (*length && at < (*events)[*length - 1].at)) {
+            printf("Invalid or out of order event at instruction %llu in %s\n", at, path);
+            fclose(fp);
+            return -1;
+        }
+        if (*length == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            *events = realloc(*events, capacity * sizeof(**events));
+        }
+        (*events)[(*length)++] = (struct InputEvent) { .at = at, .key = (uint8_t) key, .pressed = pressed != 0 };
+    }
+    if (matched != EOF || ferror(fp)) {
+        printf("Error reading input log %s\n", path);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Compares everything an engine can change, RAM and the display included, independently of the engines
+bool same_state(const struct Context *a, const struct Context *b, const uint8_t *grid_a, const uint8_t *grid_b) {
+    return a->I == b->I && a->PC == b->PC &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer &&
+           a->rng == b->rng && a->fault == b->fault &&
+           a->stack.top == b->stack.top &&
+           memcmp(a->V, b->V, sizeof(a->V)) == 0 &&
+           memcmp(a->stack.stack, b->stack.stack, sizeof(a->stack.stack)) == 0 &&
+           memcmp(a->RAM, b->RAM, sizeof(a->RAM)) == 0 &&
+           memcmp(grid_a, grid_b, DISPLAY_WIDTH * DISPLAY_HEIGHT) == 0;
+}
+
+// Runs both engines from `initial` for up to `limit` instructions, checking every `interval` instructions,
+// at the end of the run and as soon as both engines have halted. Stops early when they diverge or both halted.
+static void run_lockstep(const struct DiffOptions *options, const struct Context *initial, uint64_t interval,
+                         uint64_t limit, struct Lockstep *a, struct Lockstep *b, struct LockstepResult *result) {
+    size_t event = 0;
+    a->ctx = b->ctx = *initial;
+    memset(a->display_grid, 0, sizeof(a->display_grid));
+    memset(b->display_grid, 0, sizeof(b->display_grid));
+    result->diverged = false;
+    result->PC = result->opcode = 0;
+    for (uint64_t step = 0; step < limit; step++) {
+        bool halted;
+        for (; event < options->input_length && options->input[event].at <= step; event++) {
+            uint16_t mask = (uint16_t)(1 << options->input[event].key);
+            if (options->input[event].pressed) a->ctx.keypad |= mask;
+            else a->ctx.keypad &= ~mask;
+            b->ctx.keypad = a->ctx.keypad;
+        }
+
+        if (!a->ctx.fault && a->ctx.PC <= RAM_SIZE - 2) {
+            result->PC = a->ctx.PC;
+            result->opcode = ((uint16_t)(a->ctx.RAM[result->PC]) << 8) + a->ctx.RAM[result->PC + 1];
+        }
+        options->engine_a->step(&a->ctx, a->display_grid);
+        options->engine_b->step(&b->ctx, b->display_grid);
+
+        // timers tick at TIMER_SPEED_HZ against a CPU running at CPU_SPEED_HZ, as in the main loop
+        if ((step + 1) * TIMER_SPEED_HZ / CPU_SPEED_HZ != step * TIMER_SPEED_HZ / CPU_SPEED_HZ) {
+            decrement_timers(&a->ctx.delay_timer, &a->ctx.sound_timer);
+            decrement_timers(&b->ctx.delay_timer, &b->ctx.sound_timer);
+        }
+
+        halted = a->ctx.fault && b->ctx.fault;
+        if ((step + 1) % interval == 0 || step + 1 == limit || halted) {
+            result->executed = step + 1;
+            if (!same_state(&a->ctx, &b->ctx, a->display_grid, b->display_grid)) {
+                result->diverged = true;
+                return;
+            }
+            if (halted) return;
+        }
+    }
+    result->executed = limit;
+}
+
+void find_divergence(const struct DiffOptions *options, const struct Context *initial,
+                     struct Lockstep *a, struct Lockstep *b, struct LockstepResult *result) {
+    run_lockstep(options, initial, options->interval, options->steps, a, b, result);
+    if (result->diverged && options->interval > 1) {
+        // replay comparing after every instruction to find the first diverging one inside the window
+        run_lockstep(options, initial, 1, result->executed, a, b, result);
+    }
+}
+
+static void print_registers(const char *name, const struct Context *ctx) {
+    printf("  %-12s PC = %.4X, I = %.4X, SP = %.2X, DT = %.2X, ST = %.2X, Fault = %s\n              ",
+           name, ctx->PC, ctx->I, ctx->stack.top, ctx->delay_timer, ctx->sound_timer, fault_name(ctx->fault));
+    for (uint8_t i = 0; i < NUM_OF_VREGISTERS; i++) {
+        printf(" V%X = %.2X", i, ctx->V[i]);
+    }
+    printf("\n");
+}
+
+int diff_rom(const struct DiffOptions *options, const char *path) {
+    struct Context *initial = malloc(sizeof(*initial));
+    struct Lockstep *a = malloc(sizeof(*a));
+    struct Lockstep *b = malloc(sizeof(*b));
+    struct LockstepResult result;
+    int status;
+
+    init_context(initial, options->seed);
+    if (write_program_to_memory(path, initial->RAM + PROGRAM_START_POSITION, RAM_SIZE - PROGRAM_START_POSITION) != 0) {
+        status = DIFF_LOAD_FAILED;
+    } else {
+        find_divergence(options, initial, a, b, &result);
+        status = result.diverged ? DIFF_DIVERGED : DIFF_MATCHED;
+    }
+
+    SDL_LockMutex(output_lock);
+    if (status == DIFF_LOAD_FAILED) {
+        printf("%s: FAILED to load\n", path);
+    } else if (status == DIFF_DIVERGED) {
+        printf("%s: DIVERGED after %llu instructions, PC = %.4X, opcode = %.4X\n",
+               path, (unsigned long long) result.executed, result.PC, result.opcode);
+        print_registers(options->engine_a->name, &a->ctx);
+        print_registers(options->engine_b->name, &b->ctx);
+    } else if (a->ctx.fault) {
+        printf("%s: OK, both engines halted with %s after %llu instructions, PC = %.4X, opcode = %.4X\n",
+               path, fault_name(a->ctx.fault), (unsigned long long) result.executed, result.PC, result.opcode);
+    } else {
+        printf("%s: OK (%llu instructions)\n", path, (unsigned long long) result.executed);
+    }
+    fflush(stdout);
+    SDL_UnlockMutex(output_lock);
+
+    free(initial);
+    free(a);
+    free(b);
+    return status;
+}
+
+static uint16_t perturbed_pc;
+
+// Interpreter that makes a stray, unflagged RAM write after the instruction at perturbed_pc,
+// used to check the validator itself
+static void perturbed_step(struct Context *ctx, uint8_t *display_grid) {
+    bool perturb = ctx->PC == perturbed_pc;
+    interpreter_step(ctx, display_grid);
+    if (perturb) ctx->RAM[SELF_TEST_STRAY_ADDRESS] ^= 0xFF;
+}
+
+int diff_self_test(void) {
+    static const uint8_t loop[] = {
+            0x60, 0x05, // 200: V0 = 5
+            0x61, 0x00, // 202: V1 = 0
+            0x71, 0x01, // 204: V1 += 1
+            0x31, 0x08, // 206: skip if V1 == 8
+            0x12, 0x04, // 208: jump 204
+            0xA3, 0x00, // 20A: I = 300
+            0xF0, 0x33, // 20C: BCD of V0
+            0x12, 0x0E  // 20E: jump 20E
+    };
+    static const uint8_t underflow[] = {
+            0x60, 0x05, // 200: V0 = 5
+            0x00, 0xEE  // 202: return with an empty stack, both engines halt
+    };
+    static const struct SelfTestCase cases[] = {
+            { "stray write after FX33", loop, sizeof(loop), 0x20C, 27, 0xF033 },
+            { "stray write after 6XKK", loop, sizeof(loop), 0x202, 2, 0x6100 },
+            { "stray write before a shared fault", underflow, sizeof(underflow), 0x200, 1, 0x6005 },
+    };
+    static const struct Engine perturbed = { "perturbed", perturbed_step };
+    const uint64_t intervals[] = { 1, 10 };
+    struct DiffOptions options = {
+            .engine_a = &engines[0], .engine_b = &perturbed,
+            .seed = DIFF_DEFAULT_SEED, .steps = 1000
+    };
+    struct Context *initial = malloc(sizeof(*initial));
+    struct Lockstep *a = malloc(sizeof(*a));
+    struct Lockstep *b = malloc(sizeof(*b));
+    struct LockstepResult result;
+    int failures = 0;
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(*cases); c++) {
+        init_context(initial, options.seed);
+        memcpy(initial->RAM + PROGRAM_START_POSITION, cases[c].rom, cases[c].rom_length);
+        perturbed_pc = cases[c].PC;
+        for (size_t i = 0; i < sizeof(intervals) / sizeof(*intervals); i++) {
+            bool passed;
+            options.interval = intervals[i];
+            find_divergence(&options, initial, a, b, &result);
+            passed = result.diverged && result.executed == cases[c].instructions &&
+                     result.PC == cases[c].PC && result.opcode == cases[c].opcode;
+            printf("Self-test %s, interval %llu: %s (diverged = %d after %llu instructions, PC = %.4X, opcode = %.4X)\n",
+                   cases[c].name, (unsigned long long) options.interval, passed ? "OK" : "FAILED", result.diverged,
+                   (unsigned long long) result.executed, result.PC, result.opcode);
+            if (!passed) failures++;
+        }
+    }
+    free(initial);
+    free(a);
+    free(b);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int diff_worker(void *data) {
+    struct DiffJob *job = data;
+    int rom;
+    while ((rom = SDL_AtomicAdd(&job->next_rom, 1)) < job->options->rom_count) {
+        switch (diff_rom(job->options, job->options->roms[rom])) {
+            case DIFF_DIVERGED: SDL_AtomicAdd(&job->diverged, 1); break;
+            case DIFF_LOAD_FAILED: SDL_AtomicAdd(&job->load_failures, 1); break;
+            default: break;
+        }
+    }
+    return 0;
+}
+
+int diff_main(int argc, char *argv[]) {
+    struct DiffOptions options;
+    struct DiffJob job;
+    SDL_Thread **threads;
+
+    if (read_diff_arguments(argc, argv, &options) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (options.self_test) {
+        free(options.roms);
+        free(options.input);
+        return diff_self_test();
+    }
+    printf("Comparing %s against %s on %d ROM(s), %d job(s), seed %u, %llu instructions, interval %llu\n",
+           options.engine_a->name, options.engine_b->name, options.rom_count, options.jobs, options.seed,
+           (unsigned long long) options.steps, (unsigned long long) options.interval);
+
+    output_lock = SDL_CreateMutex();
+    job.options = &options;
+    SDL_AtomicSet(&job.next_rom, 0);
+    SDL_AtomicSet(&job.diverged, 0);
+    SDL_AtomicSet(&job.load_failures, 0);
+    threads = calloc(options.jobs, sizeof(*threads));
+    for (int i = 0; i < options.jobs; i++) {
+        threads[i] = SDL_CreateThread(diff_worker, "diff", &job);
+        if (threads[i] == NULL) {
+            // fall back to running the remaining ROMs on this thread
+            diff_worker(&job);
+            break;
+        }
+    }
+    for (int i = 0; i < options.jobs; i++) {
+        if (threads[i]) SDL_WaitThread(threads[i], NULL);
+    }
+    SDL_DestroyMutex(output_lock);
+
+    printf("%d of %d ROM(s) diverged, %d failed to load\n",
+           SDL_AtomicGet(&job.diverged), options.rom_count, SDL_AtomicGet(&job.load_failures));
+    free(threads);
+    free(options.roms);
+    free(options.input);
+    return SDL_AtomicGet(&job.diverged) || SDL_AtomicGet(&job.load_failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
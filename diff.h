@@ -0,0 +1,63 @@
+#ifndef CHIP_8_DIFF_H
+#define CHIP_8_DIFF_H
+#include "main.h"
+
+#define DIFF_DEFAULT_STEPS 100000
+#define DIFF_DEFAULT_SEED 1
+#define DIFF_MATCHED 0
+#define DIFF_DIVERGED 1
+#define DIFF_LOAD_FAILED 2
+#define SELF_TEST_STRAY_ADDRESS 0x3F0
+
+struct InputEvent {
+    uint64_t at; // instruction index the event is applied before
+    uint8_t key;
+    bool pressed;
+};
+
+struct Lockstep {
+    struct Context ctx;
+    uint8_t display_grid[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+};
+
+struct LockstepResult {
+    uint64_t executed; // instructions run when the engines diverged, both halted or the run ended
+    bool diverged;
+    uint16_t PC;       // address and opcode of the last instruction engine A executed
+    uint16_t opcode;
+};
+
+struct SelfTestCase {
+    const char *name;
+    const uint8_t *rom;
+    size_t rom_length;
+    uint16_t PC;           // the perturbed engine writes stray RAM after the instruction here,
+    uint64_t instructions; // so the first divergence must be reported at that instruction
+    uint16_t opcode;
+};
+
+struct DiffOptions {
+    const struct Engine *engine_a;
+    const struct Engine *engine_b;
+    uint32_t seed;
+    uint64_t steps;
+    uint64_t interval;
+    int jobs;
+    struct InputEvent *input;
+    size_t input_length;
+    char **roms;
+    int rom_count;
+    bool self_test;
+};
+
+int diff_main(int argc, char *argv[]);
+const struct Engine *find_engine(const char *name);
+int read_diff_arguments(int argc, char *argv[], struct DiffOptions *options);
+int read_input_log(const char *path, struct InputEvent **events, size_t *length);
+bool same_state(const struct Context *a, const struct Context *b, const uint8_t *grid_a, const uint8_t *grid_b);
+void find_divergence(const struct DiffOptions *options, const struct Context *initial,
+                     struct Lockstep *a, struct Lockstep *b, struct LockstepResult *result);
+int diff_rom(const struct DiffOptions *options, const char *path);
+int diff_self_test(void);
+
+#endif //CHIP_8_DIFF_H
@@ -1,4 +1,5 @@
 #include "main.h"
+#include "diff.h"
 
 char instructions[] = "\n\nWelcome to my CHIP-8 interpreter :)"
                       "\nTo run a program, enter the path as an argument (e.g. CHIP_8 [PATH TO .CH8/.ROM FILE] --[OPTION] ...)"
@@ -8,42 +9,42 @@ char instructions[] = "\n\nWelcome to my CHIP-8 interpreter :)"
                       "\n\t--debug, -d, turn on debugger"
                       "\n\t--shift-quirk, enable shift instruction quirk,"
                       "\n\t--store-load-quirk, enable store and load instructions quirk,"
-                      "\n\t--jump-offset-quirk, enable jump with offset instruction quirk\n\n";
+                      "\n\t--jump-offset-quirk, enable jump with offset instruction quirk"
+                      "\nTo compare two execution engines headlessly, run CHIP_8 --diff [ROM ...] --[OPTION] ..."
+                      "\nThe quirk options above apply to both engines, and additionally:"
+                      "\n\t--engine-a NAME, --engine-b NAME, engines to compare (default: interpreter),"
+                      "\n\t--seed N, random number generator seed (default: 1),"
+                      "\n\t--input PATH, input log with one \"INSTRUCTION KEY 0|1\" event per line,"
+                      "\n\t--steps N, instructions to run per ROM (default: 100000),"
+                      "\n\t--interval N, compare state every N instructions (default: 1),"
+                      "\n\t--jobs N, ROMs to run in parallel (default: CPU count),"
+                      "\n\t--self-test, check that a deliberately perturbed engine is caught at the right instruction\n\n";
 
 const uint8_t *key_state;
 bool debug_mode = false;
-bool paused = false;
-bool step = false;
+SDL_atomic_t paused;
+SDL_atomic_t step;
 bool shift_quirk = false;
 bool store_load_quirk = false;
 bool jump_offset_quirk = false;
 
 int main(int argc, char *argv[]) {
     bool close = false;
-    struct Context context = {
-            .RAM = {0},
-            .I = 0,
-            .V = {0},
-            .PC = PROGRAM_START_POSITION,
-            .stack = { .stack = {0}, .top = 0 },
-            .delay_timer = UINT8_MAX,
-            .sound_timer = UINT8_MAX
-    };
-    uint8_t display_grid[DISPLAY_WIDTH][DISPLAY_HEIGHT] = {0};
-    uint16_t opcode;
-
-    uint32_t last_cpu_tick = SDL_GetTicks();
-    uint32_t last_timer_tick = SDL_GetTicks();
-    uint32_t last_frame_tick = SDL_GetTicks();
-    uint32_t current_ticks;
+    bool halted = false;
+    struct Emulator emulator = {0};
+    const uint8_t *frame;
 
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Thread *emulation_thread;
 
-    srand((unsigned int)(time(NULL) ^ clock() ^ getpid()));
+    if (argc > 1 && strcmp("--diff", argv[1]) == 0) {
+        return diff_main(argc - 1, argv + 1);
+    }
 
-    write_font_to_memory(context.RAM);
-    if (read_arguments(argc, argv, context.RAM) != 0) {
+    init_context(&emulator.context, (uint32_t)(time(NULL) ^ clock() ^ getpid()));
+    init_frames(&emulator.frames);
+    if (read_arguments(argc, argv, emulator.context.RAM) != 0) {
         exit(EXIT_SUCCESS);
     }
     printf("Settings:\n  Debug mode: %s\n  Shift quirk: %s\n  Load/store quirk: %s\n  Jump offset quirk: %s\n",
@@ -65,9 +66,14 @@ int main(int argc, char *argv[]) {
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
 
-    while (!close) {
-        current_ticks = SDL_GetTicks();
+    // CPU and timers run on their own thread so a vsync stall in SDL_RenderPresent can't delay them
+    emulation_thread = SDL_CreateThread(emulate, "emulation", &emulator);
+    if (emulation_thread == NULL) {
+        SDL_Log("SDL_CreateThread Error: %s\n", SDL_GetError());
+        return 1;
+    }
 
+    while (!close) {
         // --- 1. INPUT HANDLING ---
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
@@ -76,62 +82,125 @@ int main(int argc, char *argv[]) {
                 close = true;
             } else if (event.type == SDL_KEYDOWN && event.key.repeat == 0) {
                 if (sc == SDL_SCANCODE_SPACE) {
-                    paused = !paused;
-                    if (paused || !debug_mode) {
-                        step = false;
+                    SDL_AtomicSet(&paused, !SDL_AtomicGet(&paused));
+                    if (SDL_AtomicGet(&paused) || !debug_mode) {
+                        SDL_AtomicSet(&step, 0);
                     }
-                    DEBUG_PRINT("Paused: %s\n", paused ? "Yes" : "No");
-                } else if (sc == SDL_SCANCODE_N && paused) {
-                    step = true;
+                    DEBUG_PRINT("Paused: %s\n", SDL_AtomicGet(&paused) ? "Yes" : "No");
+                } else if (sc == SDL_SCANCODE_N && SDL_AtomicGet(&paused)) {
+                    SDL_AtomicSet(&step, 1);
                     DEBUG_PRINT("Step one instruction\n");
                 }
             }
         }
+        SDL_AtomicSet(&emulator.keypad, read_keypad(key_state));
+
+        // === 2. RENDERING ===
+        // Only fresh frames are presented, with vsync the present itself paces this thread
+        if ((frame = acquire_frame(&emulator.frames)) != NULL) {
+            render_clear(renderer);
+            render_drawing(renderer, frame);
+            SDL_RenderPresent(renderer);
+        } else {
+            SDL_Delay(1);
+        }
+        if (!halted && SDL_AtomicGet(&emulator.halted)) {
+            // keep showing the last frame until the user closes the window
+            halted = true;
+            SDL_SetWindowTitle(window, "CHIP-8 (halted)");
+        }
+    }
+    SDL_AtomicSet(&emulator.quit, 1);
+    SDL_WaitThread(emulation_thread, NULL);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    if (emulator.context.fault) {
+        printf("%s at PC = %.4X\n", fault_name(emulator.context.fault), emulator.context.PC);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
 
-        // === 2. CPU INSTRUCTION EXECUTION ===
-        if (!paused || step) {
+int emulate(void *data) {
+    struct Emulator *emulator = data;
+    uint32_t last_cpu_tick = SDL_GetTicks();
+    uint32_t last_timer_tick = SDL_GetTicks();
+    uint32_t current_ticks;
+
+    while (!SDL_AtomicGet(&emulator->quit)) {
+        current_ticks = SDL_GetTicks();
+
+        // === 1. CPU INSTRUCTION EXECUTION ===
+        emulator->context.keypad = (uint16_t) SDL_AtomicGet(&emulator->keypad);
+        if (!SDL_AtomicGet(&paused) || SDL_AtomicGet(&step)) {
             while ((double)(current_ticks - last_cpu_tick) >= CPU_INSTR_MS) {
-                fetch(&opcode, &context.PC, context.RAM);
-                decode_execute(opcode, &context, (uint8_t *) display_grid, renderer);
+                interpreter_step(&emulator->context, emulator->display_grid);
 
                 last_cpu_tick += CPU_INSTR_MS;
 
-                if (step) {
-                    step = false;
+                if (SDL_AtomicCAS(&step, 1, 0)) {
                     break;
                 }
             }
         }
+        if (emulator->context.fault) {
+            // the machine halted, hand the last frame to the render thread and stop emulating
+            publish_frame(&emulator->frames, emulator->display_grid);
+            SDL_AtomicSet(&emulator->halted, 1);
+            break;
+        }
 
-        // === 3. TIMER DECREMENT ===
+        // === 2. TIMER DECREMENT AND FRAME PUBLISHING ===
         while ((double)(current_ticks - last_timer_tick) >= TIMER_TICK_MS) {
-            decrement_timers(&context.delay_timer, &context.sound_timer);
+            decrement_timers(&emulator->context.delay_timer, &emulator->context.sound_timer);
+            publish_frame(&emulator->frames, emulator->display_grid);
             last_timer_tick += TIMER_TICK_MS;
         }
-
-        // === 4. RENDERING ===
-        if ((double)(current_ticks - last_frame_tick) >= FRAME_MS) {
-            render_clear(renderer);
-            render_drawing(renderer, (uint8_t *) display_grid);
-            SDL_RenderPresent(renderer);
-            last_frame_tick = current_ticks;
-        }
         SDL_Delay(1);
     }
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
     return 0;
 }
 
+void init_frames(struct TripleBuffer *frames) {
+    memset(frames->frames, 0, sizeof(frames->frames));
+    frames->back = 0;
+    SDL_AtomicSet(&frames->middle, 1);
+    frames->front = 2;
+}
+
+// SDL_AtomicSet only guarantees acquire ordering, a CAS loop also publishes the frame written before it
+int exchange_frame(SDL_atomic_t *middle, int value) {
+    int old;
+    do {
+        old = SDL_AtomicGet(middle);
+    } while (!SDL_AtomicCAS(middle, old, value));
+    return old;
+}
+
+// Writer side: fill the back frame, then swap it with the middle one and mark it fresh
+void publish_frame(struct TripleBuffer *frames, const uint8_t *display_grid) {
+    memcpy(frames->frames[frames->back], display_grid, DISPLAY_WIDTH * DISPLAY_HEIGHT);
+    frames->back = exchange_frame(&frames->middle, frames->back | FRAME_FRESH) & FRAME_INDEX_MASK;
+}
+
+// Reader side: take the middle frame if a fresh one was published, otherwise return NULL
+const uint8_t *acquire_frame(struct TripleBuffer *frames) {
+    if (!(SDL_AtomicGet(&frames->middle) & FRAME_FRESH)) return NULL;
+    frames->front = exchange_frame(&frames->middle, frames->front) & FRAME_INDEX_MASK;
+    return frames->frames[frames->front];
+}
+
 void clear_screen(uint8_t *display) {
     DEBUG_PRINT("00E0 - Clear the display\n\n");
     uint8_t *i = display;
     while (i < display + DISPLAY_WIDTH * DISPLAY_HEIGHT) *(i++) = 0;
 }
 
-void return_from_subroutine(struct Stack *stack, uint16_t *PC) {
-    *PC = pop(stack);
+void return_from_subroutine(struct Stack *stack, uint16_t *PC, uint8_t *fault) {
+    uint16_t address = pop(stack, fault);
+    // on a fault PC stays on the faulting instruction
+    *PC = *fault ? *PC - 2 : address;
     DEBUG_PRINT("00EE - Return from subroutine,\n"
                 "          PC  = %.4X\n\n", *PC);
 }
@@ -142,11 +211,11 @@ void jump(uint16_t *PC, uint16_t location) {
     *PC = location;
 }
 
-void call_subroutine(struct Stack *stack, uint16_t *PC, uint16_t location) {
+void call_subroutine(struct Stack *stack, uint16_t *PC, uint16_t location, uint8_t *fault) {
     DEBUG_PRINT("2NNN - Call subroutine at NNN,\n"
                 "          PC  = %.4X, NNN = %.4X\n\n", *PC, location);
-    push(stack, *PC);
-    *PC = location;
+    push(stack, *PC, fault);
+    *PC = *fault ? *PC - 2 : location;
 }
 
 void skip_vx_e_nn(uint16_t *PC, uint8_t V, uint8_t value) {
@@ -265,22 +334,27 @@ void jump_offset(uint16_t *PC, uint16_t address, uint8_t V0, uint8_t VX) {
 
     *PC = address + offset;
 }
-void random(uint8_t *V, uint8_t value) {
-    *V = (uint8_t)(rand() & 0xFF) & value;
+void random_v(uint8_t *V, uint8_t value, uint32_t *rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+    *V = (uint8_t)(*rng & 0xFF) & value;
     DEBUG_PRINT("CXKK - Set VX = (random byte & KK),\n"
                 "          VX  = %.2X\n\n", *V);
 }
 
-void skip_key_v(uint8_t V, uint16_t *PC) {
+void skip_key_v(uint8_t V, uint16_t keypad, uint16_t *PC) {
+    bool pressed = V <= 0xF && (keypad >> V) & 0x1;
     DEBUG_PRINT("EXA1 - Skip if key with the value VX is pressed,\n"
-                "          VX  = %.2X, Pressed = %d\n\n", V, key_state[keypad_to_scancode(V)]);
-    if (key_state[keypad_to_scancode(V)]) *PC += 2;
+                "          VX  = %.2X, Pressed = %d\n\n", V, pressed);
+    if (pressed) *PC += 2;
 }
 
-void skip_key_n_v(uint8_t V, uint16_t *PC) {
+void skip_key_n_v(uint8_t V, uint16_t keypad, uint16_t *PC) {
+    bool pressed = V <= 0xF && (keypad >> V) & 0x1;
     DEBUG_PRINT("EXA1 - Skip if key with the value VX is NOT pressed,\n"
-                "          VX  = %.2X, Pressed = %d\n\n", V, key_state[keypad_to_scancode(V)]);
-    if (!key_state[keypad_to_scancode(V)]) *PC += 2;
+                "          VX  = %.2X, Pressed = %d\n\n", V, pressed);
+    if (!pressed) *PC += 2;
 }
 
 void set_v_delay(uint8_t *V, uint8_t delay_timer) {
@@ -308,11 +382,11 @@ void add_i_v(uint16_t *I, uint8_t V, uint8_t *VF) {
     *I += V;
 }
 
-void get_key(uint8_t *V, uint16_t *PC) {
+void get_key(uint8_t *V, uint16_t keypad, uint16_t *PC) {
     uint8_t key;
     bool pressed = false;
     for (key = 0; key < 0x10; key++) {
-        if (key_state[keypad_to_scancode(key)]) {
+        if ((keypad >> key) & 0x1) {
             pressed = true;
             *V = key;
             break;
@@ -333,11 +407,11 @@ void binary_coded_decimal_conversion(uint8_t *RAM, uint16_t I, uint8_t V) {
     DEBUG_PRINT("FX33 - Store BCD of VX in memory at I, I+1, I+2,\n"
                 "          VX  = %.2X -> [%d, %d, %d] at I = %.4X\n\n",
                 V, V / 100, (V / 10) % 10, V % 10, I);
-    *(RAM + I + 2) = V % 10;
+    *(RAM + ((I + 2) & (RAM_SIZE - 1))) = V % 10;
     V /= 10;
-    *(RAM + I + 1) = V % 10;
+    *(RAM + ((I + 1) & (RAM_SIZE - 1))) = V % 10;
     V /= 10;
-    *(RAM + I) = V;
+    *(RAM + (I & (RAM_SIZE - 1))) = V;
 }
 
 void store_to_memory(uint8_t *RAM, uint16_t *I, uint8_t *V, uint8_t VX) {
@@ -345,7 +419,7 @@ void store_to_memory(uint8_t *RAM, uint16_t *I, uint8_t *V, uint8_t VX) {
                 "          I = %.4X, VX  = %.2X\n\n", *I, VX);
     uint16_t tempI = *I;
     for (uint8_t i = 0; i <= VX; i++) {
-        RAM[tempI++] = V[i];
+        RAM[tempI++ & (RAM_SIZE - 1)] = V[i];
     }
     if (store_load_quirk) {
         *I += VX + 1;
@@ -357,7 +431,7 @@ void load_from_memory(uint8_t *RAM, uint16_t *I, uint8_t *V, uint8_t VX) {
                 "          I = %.4X, VX  = %.2X\n\n", *I, VX);
     uint16_t tempI = *I;
     for (uint8_t i = 0; i <= VX; i++) {
-        V[i] = RAM[tempI++];
+        V[i] = RAM[tempI++ & (RAM_SIZE - 1)];
     }
     if (store_load_quirk) {
         *I += VX + 1;
@@ -371,7 +445,7 @@ void draw(uint8_t *display_grid, uint8_t *RAM, uint16_t *I, uint8_t *V, uint8_t
     *(V + 0xF) = 0;
     DEBUG_PRINT("DXYN - Draw sprite at (VX, VY) = (%d, %d) with height %u from I = %.4X\n\n", VX, VY, N, *I);
     for (row = 0; row < N; row++) {
-        byte = *(RAM + *I + row);
+        byte = *(RAM + ((*I + row) & (RAM_SIZE - 1)));
         for (col = 0; col < 8; col++) {
             pixel = (byte >> (7 - col)) & 0x1;
             if (pixel) {
@@ -383,7 +457,7 @@ void draw(uint8_t *display_grid, uint8_t *RAM, uint16_t *I, uint8_t *V, uint8_t
     }
 }
 
-void render_drawing(SDL_Renderer *renderer, uint8_t *display_grid) {
+void render_drawing(SDL_Renderer *renderer, const uint8_t *display_grid) {
     uint16_t row, col;
     col = row = 0;
     SDL_Rect rect;
@@ -395,7 +469,6 @@ void render_drawing(SDL_Renderer *renderer, uint8_t *display_grid) {
         }
         if (++col == DISPLAY_WIDTH) {col = 0; row++;}
     }
-    SDL_RenderPresent(renderer);
 }
 
 void render_clear(SDL_Renderer *renderer) {
@@ -408,7 +481,18 @@ void fetch(uint16_t *opcode, uint16_t *PC, uint8_t *RAM) {
     *PC += 2;
 }
 
-void decode_execute(uint16_t opcode, struct Context *ctx, uint8_t *display_grid, SDL_Renderer *renderer) {
+void interpreter_step(struct Context *ctx, uint8_t *display_grid) {
+    uint16_t opcode;
+    if (ctx->fault) return;
+    if (ctx->PC > RAM_SIZE - 2) {
+        ctx->fault = FAULT_PC_OUT_OF_RANGE;
+        return;
+    }
+    fetch(&opcode, &ctx->PC, ctx->RAM);
+    decode_execute(opcode, ctx, display_grid);
+}
+
+void decode_execute(uint16_t opcode, struct Context *ctx, uint8_t *display_grid) {
     uint16_t nib1 = opcode & 0xF000; // first nibble
     uint16_t nib2 = (opcode & 0x0F00) >> 8; // second nibble
     uint8_t nib3 = (opcode & 0x00F0) >> 4;  // third nibble
@@ -419,11 +503,11 @@ void decode_execute(uint16_t opcode, struct Context *ctx, uint8_t *display_grid,
                 case 0x0:
                     clear_screen(display_grid);
                     break;
-                case 0xE: return_from_subroutine(&ctx->stack, &ctx->PC); break;
+                case 0xE: return_from_subroutine(&ctx->stack, &ctx->PC, &ctx->fault); break;
                 default: break;
             } break;
         case 0x1000: jump(&ctx->PC, opcode & 0x0FFF); break;
-        case 0x2000: call_subroutine(&ctx->stack, &ctx->PC, opcode & 0x0FFF); break;
+        case 0x2000: call_subroutine(&ctx->stack, &ctx->PC, opcode & 0x0FFF, &ctx->fault); break;
         case 0x3000: skip_vx_e_nn(&ctx->PC, ctx->V[nib2], opcode & 0x00FF); break;
         case 0x4000: skip_vx_not_e_nn(&ctx->PC, ctx->V[nib2], opcode & 0x00FF); break;
         case 0x5000: skip_vx_e_vy(&ctx->PC, ctx->V[nib2], ctx->V[nib3]); break;
@@ -445,14 +529,14 @@ void decode_execute(uint16_t opcode, struct Context *ctx, uint8_t *display_grid,
         case 0x9000: skip_vx_not_e_vy(&ctx->PC, ctx->V[nib2], ctx->V[nib3]); break;
         case 0xA000: set_i(&ctx->I, opcode & 0x0FFF); break;
         case 0xB000: jump_offset(&ctx->PC, opcode & 0x0FFF, ctx->V[0x0], ctx->V[nib2]); break;
-        case 0xC000: random(&ctx->V[nib2], opcode & 0x00FF); break;
+        case 0xC000: random_v(&ctx->V[nib2], opcode & 0x00FF, &ctx->rng); break;
         case 0xD000:
             draw(display_grid, ctx->RAM, &ctx->I, ctx->V, nib2, nib3, nib4);
             break;
         case 0xE000:
             switch (opcode & 0x00FF) {
-                case 0x9E: skip_key_v(ctx->V[nib2], &ctx->PC); break;
-                case 0xA1: skip_key_n_v(ctx->V[nib2], &ctx->PC); break;
+                case 0x9E: skip_key_v(ctx->V[nib2], ctx->keypad, &ctx->PC); break;
+                case 0xA1: skip_key_n_v(ctx->V[nib2], ctx->keypad, &ctx->PC); break;
             } break;
         case 0xF000:
             switch (opcode & 0x00FF) {
@@ -460,7 +544,7 @@ void decode_execute(uint16_t opcode, struct Context *ctx, uint8_t *display_grid,
                 case 0x15: set_delay_v(&ctx->delay_timer, ctx->V[nib2]); break;
                 case 0x18: set_sound_v(&ctx->sound_timer, ctx->V[nib2]); break;
                 case 0x1E: add_i_v(&ctx->I, ctx->V[nib2], &ctx->V[0xF]); break;
-                case 0x0A: get_key(ctx->V + nib2, &ctx->PC); break;
+                case 0x0A: get_key(ctx->V + nib2, ctx->keypad, &ctx->PC); break;
                 case 0x29: font_character(&ctx->I, ctx->V[nib2]); break;
                 case 0x33: binary_coded_decimal_conversion(ctx->RAM, ctx->I, ctx->V[nib2]); break;
                 case 0x55: store_to_memory(ctx->RAM, &ctx->I, ctx->V, nib2); break;
@@ -495,6 +579,23 @@ uint8_t keypad_to_scancode(uint8_t k) {
     return SCANCODE;
 }
 
+uint16_t read_keypad(const uint8_t *key_state) {
+    uint16_t keypad = 0;
+    for (uint8_t key = 0; key < 0x10; key++) {
+        if (key_state[keypad_to_scancode(key)]) keypad |= (uint16_t)(1 << key);
+    }
+    return keypad;
+}
+
+void init_context(struct Context *ctx, uint32_t seed) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->PC = PROGRAM_START_POSITION;
+    ctx->delay_timer = UINT8_MAX;
+    ctx->sound_timer = UINT8_MAX;
+    ctx->rng = seed ? seed : 1;
+    write_font_to_memory(ctx->RAM);
+}
+
 int read_arguments(int argc, char *argv[], uint8_t *RAM) {
     int32_t i = 1;
     if (!argv[1] || strlen(argv[1]) == 0) {
@@ -506,7 +607,7 @@ int read_arguments(int argc, char *argv[], uint8_t *RAM) {
             printf("%s", instructions);
             return -1;
         } else if (strcmp("--debug", argv[i]) == 0 || strcmp("-d", argv[i]) == 0) {
-            debug_mode = true; paused = true;
+            debug_mode = true; SDL_AtomicSet(&paused, 1);
         } else if (strcmp("--shift-quirk", argv[i]) == 0) {
             shift_quirk = true;
         } else if (strcmp("--store-load-quirk", argv[i]) == 0) {
@@ -514,27 +615,35 @@ int read_arguments(int argc, char *argv[], uint8_t *RAM) {
         } else if (strcmp("--jump-offset-quirk", argv[i]) == 0) {
             jump_offset_quirk = true;
         } else if (i == 1) {
-            write_program_to_memory(argv[1], RAM + PROGRAM_START_POSITION);
+            if (write_program_to_memory(argv[1], RAM + PROGRAM_START_POSITION,
+                                        RAM_SIZE - PROGRAM_START_POSITION) != 0) {
+                exit(EXIT_FAILURE);
+            }
         }
     }
     return 0;
 }
 
-void write_program_to_memory(char *path, uint8_t *RAM) {
+int write_program_to_memory(const char *path, uint8_t *RAM, size_t size) {
+    size_t length;
     FILE *fp = fopen(path, "rb");
     if (fp == NULL) {
         printf("Can't open %s\n", path);
-        exit(EXIT_FAILURE);
-    }
-    while (fread(RAM, sizeof(*RAM), 1, fp) == 1) {
-        RAM++;
+        return -1;
     }
+    length = fread(RAM, sizeof(*RAM), size, fp);
     if (ferror(fp)) {
         printf("Error reading from file %s\n", path);
         fclose(fp);
-        exit(EXIT_FAILURE);
+        return -1;
+    }
+    if (length == size && fgetc(fp) != EOF) {
+        printf("%s is larger than the %u bytes of program memory\n", path, (unsigned int) size);
+        fclose(fp);
+        return -1;
     }
     fclose(fp);
+    return 0;
 }
 
 void write_font_to_memory(uint8_t *RAM) {
@@ -568,26 +677,38 @@ void decrement_timers(uint8_t *delay_timer, uint8_t *sound_timer) {
     }
 }
 
-void stack_overflow() {
-    printf("Stack Overflow");
-    exit(EXIT_FAILURE);
+const char *fault_name(uint8_t fault) {
+    switch (fault) {
+        case FAULT_NONE: return "None";
+        case FAULT_STACK_OVERFLOW: return "Stack Overflow";
+        case FAULT_STACK_UNDERFLOW: return "Stack Underflow";
+        case FAULT_PC_OUT_OF_RANGE: return "PC Out Of Range";
+        default: return "Unknown";
+    }
+}
+
+void stack_overflow(uint8_t *fault) {
+    DEBUG_PRINT("Stack Overflow\n");
+    *fault = FAULT_STACK_OVERFLOW;
 }
 
-void stack_underflow() {
-    printf("Stack Underflow");
-    exit(EXIT_FAILURE);
+void stack_underflow(uint8_t *fault) {
+    DEBUG_PRINT("Stack Underflow\n");
+    *fault = FAULT_STACK_UNDERFLOW;
 }
 
-uint16_t pop(struct Stack *stack) {
+uint16_t pop(struct Stack *stack, uint8_t *fault) {
     if (stack->top == 0) {
-        stack_underflow();
+        stack_underflow(fault);
+        return 0;
     }
     return stack->stack[--stack->top];
 }
 
-void push(struct Stack *stack, uint16_t value) {
+void push(struct Stack *stack, uint16_t value, uint8_t *fault) {
     if (stack->top == STACK_SIZE) {
-        stack_overflow();
+        stack_overflow(fault);
+        return;
     }
     stack->stack[stack->top++] = value;
 }
@@ -4,7 +4,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 #include <SDL.h>
 
 #define RAM_SIZE 4096
@@ -20,10 +26,14 @@
 
 #define CPU_SPEED_HZ 700
 #define TIMER_SPEED_HZ 60
-#define FPS 60
 #define CPU_INSTR_MS (1000.0f / CPU_SPEED_HZ)
 #define TIMER_TICK_MS (1000.0f / TIMER_SPEED_HZ)
-#define FRAME_MS (1000.0f / FPS)
+#define FAULT_NONE 0
+#define FAULT_STACK_OVERFLOW 1
+#define FAULT_STACK_UNDERFLOW 2
+#define FAULT_PC_OUT_OF_RANGE 3
+#define FRAME_INDEX_MASK 0x3
+#define FRAME_FRESH 0x4
 
 struct Stack {
     uint16_t stack[STACK_SIZE];
@@ -38,20 +48,51 @@ struct Context {
     struct Stack stack;
     uint8_t delay_timer;
     uint8_t sound_timer;
+    uint16_t keypad; // bit k set while keypad key k is held
+    uint32_t rng;    // xorshift32 state for CXKK, never 0
+    uint8_t fault;   // FAULT_* that halted the machine, FAULT_NONE while running
 };
 
-uint16_t pop(struct Stack *stack);
-void push(struct Stack *stack, uint16_t value);
-void stack_overflow(void);
-void stack_underflow(void);
+struct Engine {
+    const char *name;
+    void (*step)(struct Context *ctx, uint8_t *display_grid); // fetch and execute one instruction
+};
+
+// Lock-free triple buffer, the emulation thread writes frames and the render thread reads them
+struct TripleBuffer {
+    uint8_t frames[3][DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    SDL_atomic_t middle; // frame index between the threads, with FRAME_FRESH set until the reader takes it
+    uint8_t back;        // owned by the emulation thread
+    uint8_t front;       // owned by the render thread
+};
+
+struct Emulator {
+    struct Context context; // owned by the emulation thread
+    uint8_t display_grid[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    struct TripleBuffer frames;
+    SDL_atomic_t keypad;    // keypad bitmask snapshot published by the render thread
+    SDL_atomic_t quit;
+    SDL_atomic_t halted;    // set by the emulation thread when a fault stopped the machine
+};
+
+extern bool debug_mode;
+extern bool shift_quirk;
+extern bool store_load_quirk;
+extern bool jump_offset_quirk;
+
+uint16_t pop(struct Stack *stack, uint8_t *fault);
+void push(struct Stack *stack, uint16_t value, uint8_t *fault);
+void stack_overflow(uint8_t *fault);
+void stack_underflow(uint8_t *fault);
+const char *fault_name(uint8_t fault);
 
 // 0
 void clear_screen(uint8_t *display);
-void return_from_subroutine(struct Stack *stack, uint16_t *PC);
+void return_from_subroutine(struct Stack *stack, uint16_t *PC, uint8_t *fault);
 // 1
 void jump(uint16_t *PC, uint16_t location);
 // 2
-void call_subroutine(struct Stack *stack, uint16_t *PC, uint16_t location);
+void call_subroutine(struct Stack *stack, uint16_t *PC, uint16_t location, uint8_t *fault);
 // 3
 void skip_vx_e_nn(uint16_t *PC, uint8_t V, uint8_t value);
 // 4
@@ -79,31 +120,39 @@ void set_i(uint16_t *I, uint16_t value);
 // B
 void jump_offset(uint16_t *PC, uint16_t address, uint8_t V0, uint8_t VX);
 // C
-void random(uint8_t *V, uint8_t value);
+void random_v(uint8_t *V, uint8_t value, uint32_t *rng);
 // D
 void draw(uint8_t *display_grid, uint8_t *RAM, uint16_t *I, uint8_t *V, uint8_t VX, uint8_t VY, uint8_t N);
 // E
-void skip_key_v(uint8_t V, uint16_t *PC);
-void skip_key_n_v(uint8_t V, uint16_t *PC);
+void skip_key_v(uint8_t V, uint16_t keypad, uint16_t *PC);
+void skip_key_n_v(uint8_t V, uint16_t keypad, uint16_t *PC);
 // F
 void set_v_delay(uint8_t *V, uint8_t delay_timer);
 void set_delay_v(uint8_t *delay_timer, uint8_t V);
 void set_sound_v(uint8_t *sound_timer, uint8_t V);
 void add_i_v(uint16_t *I, uint8_t V, uint8_t *VF);
-void get_key(uint8_t *V, uint16_t *PC);
+void get_key(uint8_t *V, uint16_t keypad, uint16_t *PC);
 void font_character(uint16_t *I, uint8_t V);
 void binary_coded_decimal_conversion(uint8_t *RAM, uint16_t I, uint8_t V);
 void store_to_memory(uint8_t *RAM, uint16_t *I, uint8_t *V, uint8_t VX);
 void load_from_memory(uint8_t *RAM, uint16_t *I, uint8_t *V, uint8_t VX);
 // utility
+void init_context(struct Context *ctx, uint32_t seed);
 int read_arguments(int argc, char *argv[], uint8_t *RAM);
-void write_program_to_memory(char *path, uint8_t *RAM);
+int write_program_to_memory(const char *path, uint8_t *RAM, size_t size);
 void write_font_to_memory(uint8_t *RAM);
 void decrement_timers(uint8_t *delay_timer, uint8_t *sound_timer);
 uint8_t keypad_to_scancode(uint8_t k);
+uint16_t read_keypad(const uint8_t *key_state);
 void fetch(uint16_t *opcode, uint16_t *PC, uint8_t *RAM);
-void decode_execute(uint16_t opcode, struct Context *ctx, uint8_t *display_grid, SDL_Renderer *renderer);
-void render_drawing(SDL_Renderer *renderer, uint8_t *display_grid);
+void decode_execute(uint16_t opcode, struct Context *ctx, uint8_t *display_grid);
+void interpreter_step(struct Context *ctx, uint8_t *display_grid);
+int emulate(void *data);
+void init_frames(struct TripleBuffer *frames);
+int exchange_frame(SDL_atomic_t *middle, int value);
+void publish_frame(struct TripleBuffer *frames, const uint8_t *display_grid);
+const uint8_t *acquire_frame(struct TripleBuffer *frames);
+void render_drawing(SDL_Renderer *renderer, const uint8_t *display_grid);
 void render_clear(SDL_Renderer *renderer);
 
 #endif //CHIP_8_MAIN_H
\ No newline at end of file